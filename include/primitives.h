@@ -6,6 +6,15 @@
 #include <set>
 #include <algorithm>
 #include <memory>
+#include <queue>
+#include <optional>
+#include <limits>
+#include <vector>
+#include <variant>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
 
 class Point {
 public:
@@ -92,6 +101,9 @@ namespace rbtree {
 
         PointSet() = default;
 
+        template <class InputIt>
+        PointSet(InputIt first, InputIt last) : m_set(first, last) {}
+
         bool empty() const { return m_set.empty(); }
 
         std::size_t size() const { return m_set.size(); }
@@ -137,6 +149,10 @@ namespace rbtree {
                 }
                 it++;
             }
+            if (it_ans == end())
+            {
+                return {};
+            }
             return *it_ans;
         }
 
@@ -208,12 +224,23 @@ namespace kdtree {
         explicit Node(const std::shared_ptr<Node>& node)
                 : m_point(node->m_point), m_left(node->m_left), m_right(node->m_right), m_next_dfs(node->m_next_dfs), m_split(node->m_split) {}
 
+        // breaks the links of this node and of every node after it in DFS order; done iteratively
+        // since the chain is as long as the set and no node may be destroyed while still linked
         void unlink() {
-            auto next = m_next_dfs;
+            std::vector<std::shared_ptr<Node>> nodes;
+            for (auto next = m_next_dfs; next; next = next->m_next_dfs)
+            {
+                nodes.push_back(next);
+            }
             m_next_dfs = nullptr;
             m_left = nullptr;
             m_right = nullptr;
-            if (next) next->unlink();
+            for (auto &node : nodes)
+            {
+                node->m_next_dfs = nullptr;
+                node->m_left = nullptr;
+                node->m_right = nullptr;
+            }
         }
 
         ~Node() = default;
@@ -273,6 +300,16 @@ namespace kdtree {
 
         using ForwardIt = PointSetIterator;
 
+        PointSet() = default;
+
+        // inserts medians first, so the tree is balanced whatever the order of the input
+        template <class InputIt>
+        PointSet(InputIt first, InputIt last)
+        {
+            std::vector<Point> points(first, last);
+            load(points, 0, points.size(), true);
+        }
+
         ~PointSet();
 
         bool empty() const;
@@ -293,6 +330,14 @@ namespace kdtree {
 
         std::pair<ForwardIt, ForwardIt> nearest(const Point &, std::size_t) const;
 
+        // calls visit(point) for every point inside rect without storing the result
+        template <class Visit>
+        void visit_range(const Rect &rect, Visit visit) const { visit_range(m_root, rect, visit); }
+
+        // merges the k nearest points into a max-heap of (distance, point) holding at most k entries,
+        // pruning with the candidates already in it
+        void nearest(const Point &, std::size_t, std::priority_queue<std::pair<double, Point>> &) const;
+
         friend std::ostream &operator<<(std::ostream &, const PointSet &);
 
     private:
@@ -316,17 +361,404 @@ namespace kdtree {
 
         void clear(const std::shared_ptr<Node>& node) const;
 
+        void load(std::vector<Point> &points, std::size_t first, std::size_t last, bool split);
+
         void put(const std::shared_ptr<Node>& node, const Point &p, bool split, const std::shared_ptr<Node>& next_dfs) const;
 
         bool contains(const std::shared_ptr<Node>& node, const Point &p) const;
 
-        void range(const std::shared_ptr<Node>& node, const Rect &rect) const;
+        template <class Visit>
+        void visit_range(const std::shared_ptr<Node>& node, const Rect &rect, Visit &visit) const
+        {
+            if (node == nullptr)
+            {
+                return;
+            }
+
+            if (rect.contains(node->m_point))
+            {
+                visit(node->m_point);
+            }
+
+            double min = (node->m_split) ? rect.xmin() : rect.ymin();
+            double max = (node->m_split) ? rect.xmax() : rect.ymax();
+            double coord = (node->m_split) ? node->m_point.x() : node->m_point.y();
+            if (min <= coord && coord <= max)
+            {
+                visit_range(node->m_left, rect, visit);
+                visit_range(node->m_right, rect, visit);
+            }
+            else if (min > coord)
+            {
+                visit_range(node->m_right, rect, visit);
+            }
+            else
+            {
+                visit_range(node->m_left, rect, visit);
+            }
+        }
 
         Point nearest(const std::shared_ptr<Node>& node, const Point &p, const Point& nearest) const;
 
-        void nearest(const std::shared_ptr<Node>& node, bool split, std::map<double, std::shared_ptr<Node>> &nodes,
-                     double closest, const Point &p, const std::size_t &k, size_t size) const;
+        void nearest(const std::shared_ptr<Node>& node, std::priority_queue<std::pair<double, Point>> &nodes,
+                     const Point &p, std::size_t k) const;
+
+    };
+
+}
+
+namespace grid {
+
+    // Uniform grid in CSR layout: points of cell i are m_points[m_cell_start[i] .. m_cell_start[i + 1]).
+    // The grid spans the 0.1% to 99.9% quantiles of the coordinates at the last build; points outside
+    // it are also kept in a 2-d tree, so every cell holds only points within its rectangle and a few
+    // far outliers cannot stretch the cells. Points added by put() after the last build are appended
+    // to m_points and chained into the overflow list of their cell. The grid is rebuilt once the
+    // points put since the last build outnumber the indexed ones, so put() is amortized O(1) but
+    // stalls for an O(N) rebuild each time the set doubles.
+    // range() and nearest(p, k) return iterators into a buffer reused by the next call of the same kind.
+    class PointSet {
+    public:
+
+        using ForwardIt = std::vector<Point>::const_iterator;
+
+        PointSet() = default;
+
+        template <class InputIt>
+        PointSet(InputIt first, InputIt last) : m_points(first, last) { build(true); }
+
+        bool empty() const;
+
+        std::size_t size() const;
+
+        void put(const Point &);
+
+        bool contains(const Point &) const;
+
+        // second iterator points to an element out of range; valid until the next range()
+        std::pair<ForwardIt, ForwardIt> range(const Rect &) const;
+
+        ForwardIt begin() const;
+
+        ForwardIt end() const;
+
+        std::optional<Point> nearest(const Point &) const;
+
+        // points are ordered by distance; second iterator points to an element out of range;
+        // valid until the next nearest(p, k)
+        std::pair<ForwardIt, ForwardIt> nearest(const Point &, std::size_t) const;
+
+        friend std::ostream &operator<<(std::ostream &, const PointSet &);
+
+    private:
+
+        static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+        std::vector<Point> m_points{};
+        std::vector<std::size_t> m_cell_start{};
+        std::size_t m_indexed = 0;
+        std::vector<std::size_t> m_overflow_head{}; // per cell, index into m_points or npos
+        std::vector<std::size_t> m_overflow_next{}; // per point past m_indexed, npos outside the grid
+        std::unique_ptr<kdtree::PointSet> m_outside = std::make_unique<kdtree::PointSet>();
+
+        double m_xmin = 0;
+        double m_ymin = 0;
+        double m_xmax = 0;
+        double m_ymax = 0;
+        double m_cell_w = 1;
+        double m_cell_h = 1;
+        std::size_t m_nx = 0;
+        std::size_t m_ny = 0;
+
+        mutable std::vector<Point> m_ans_range{};
+        mutable std::vector<Point> m_ans_nearest{};
+
+        void build(bool dedup);
+
+        bool inside(const Point &p) const;
+
+        std::size_t cell(const Point &p) const;
+
+        template <class Visit>
+        void visit_cell(std::size_t cell, Visit visit) const;
+
+        template <class Visit, class Done>
+        void visit_rings(const Point &p, Visit visit, Done done) const;
+
+        void nearest(const Point &p, std::size_t k, std::priority_queue<std::pair<double, Point>> &heap) const;
+
+    };
+
+}
+
+namespace adaptive {
+
+    enum class Backend { Grid, KdTree };
+
+    class PointSetIterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Point;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Point *;
+        using reference = const Point &;
+
+        explicit PointSetIterator(grid::PointSet::ForwardIt it) : m_it(it) {}
+
+        explicit PointSetIterator(kdtree::PointSet::ForwardIt it) : m_it(std::move(it)) {}
+
+        const Point &operator*() const
+        {
+            return std::visit([](auto &it) -> const Point & { return *it; }, m_it);
+        }
+
+        const Point *operator->() const
+        {
+            return &**this;
+        }
+
+        PointSetIterator &operator++()
+        {
+            std::visit([](auto &it) { ++it; }, m_it);
+            return *this;
+        }
+        // ++i
+
+        PointSetIterator operator++(int)
+        {
+            PointSetIterator it = *this;
+            ++*this;
+            return it;
+        }
+        // i++
+
+        bool operator==(const PointSetIterator &it) const
+        {
+            return m_it == it.m_it;
+        }
+
+        bool operator!=(const PointSetIterator &it) const
+        {
+            return !(it == *this);
+        }
+
+    private:
+        mutable std::variant<grid::PointSet::ForwardIt, kdtree::PointSet::ForwardIt> m_it;
+    };
+
+    // Samples the points and stores them in a uniform grid when they are spread evenly over their
+    // bounding box (outliers aside), or in a 2-d tree otherwise. The choice is made at bulk-load time
+    // and again each time put() doubles the set, which may move every point to the other backend
+    // and invalidates earlier results.
+    // With the grid backend, range() and nearest(p, k) results are valid until the next call of the same kind.
+    class PointSet {
+    public:
+
+        using ForwardIt = PointSetIterator;
+
+        PointSet();
+
+        template <class InputIt>
+        PointSet(InputIt first, InputIt last) { load(std::vector<Point>(first, last)); }
+
+        Backend backend() const;
+
+        bool empty() const;
+
+        std::size_t size() const;
+
+        void put(const Point &);
+
+        bool contains(const Point &) const;
+
+        // second iterator points to an element out of range
+        std::pair<ForwardIt, ForwardIt> range(const Rect &) const;
+
+        ForwardIt begin() const;
+
+        ForwardIt end() const;
+
+        std::optional<Point> nearest(const Point &) const;
+
+        // second iterator points to an element out of range
+        std::pair<ForwardIt, ForwardIt> nearest(const Point &, std::size_t) const;
+
+        friend std::ostream &operator<<(std::ostream &, const PointSet &);
+
+    private:
+
+        std::unique_ptr<grid::PointSet> m_grid{};
+        std::unique_ptr<kdtree::PointSet> m_kdtree{};
+        std::size_t m_chosen_size = 0; // size at the last choice of backend
+
+        void load(std::vector<Point> points);
+
+        static Backend choose(const std::vector<Point> &points);
 
     };
 
-}
\ No newline at end of file
+}
+
+namespace sharded {
+
+    // Region of the plane owned by one shard: [xmin, xmax) x [ymin, ymax), bounds may be infinite.
+    struct Shard
+    {
+        double m_xmin = -std::numeric_limits<double>::infinity();
+        double m_ymin = -std::numeric_limits<double>::infinity();
+        double m_xmax = std::numeric_limits<double>::infinity();
+        double m_ymax = std::numeric_limits<double>::infinity();
+        kdtree::PointSet m_points{};
+        mutable std::mutex m_mutex{};
+
+        Shard() = default;
+
+        template <class InputIt>
+        Shard(InputIt first, InputIt last) : m_points(first, last) {}
+
+        bool intersects(const Rect &rect) const;
+
+        double distance(const Point &p) const;
+    };
+
+    // Node of the kd-split directory mapping points to shards.
+    struct Split
+    {
+        bool m_leaf = true;
+        std::size_t m_shard = 0;
+        bool m_split = true; // true for vertical; false for horizontal
+        double m_value = 0;
+        std::size_t m_left = 0;
+        std::size_t m_right = 0;
+    };
+
+    class PointSetIterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Point;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Point *;
+        using reference = const Point &;
+
+        explicit PointSetIterator(std::vector<Point>::const_iterator it) : m_it(it) {}
+
+        PointSetIterator(const std::vector<std::unique_ptr<Shard>> *shards, std::size_t shard, kdtree::PointSet::ForwardIt it);
+
+        const Point &operator*() const;
+
+        const Point *operator->() const
+        {
+            return &**this;
+        }
+
+        PointSetIterator &operator++();
+        // ++i
+
+        PointSetIterator operator++(int)
+        {
+            PointSetIterator it = *this;
+            ++*this;
+            return it;
+        }
+        // i++
+
+        bool operator==(const PointSetIterator &it) const
+        {
+            return m_it == it.m_it && m_shard == it.m_shard;
+        }
+
+        bool operator!=(const PointSetIterator &it) const
+        {
+            return !(it == *this);
+        }
+
+    private:
+        const std::vector<std::unique_ptr<Shard>> *m_shards = nullptr;
+        std::size_t m_shard = 0;
+        mutable std::variant<std::vector<Point>::const_iterator, kdtree::PointSet::ForwardIt> m_it;
+
+        void skip_empty();
+    };
+
+    // Splits the plane into regions, each stored in its own kdtree::PointSet behind its own lock.
+    // put, contains, range and nearest may be called from several threads at once; a shard that grows
+    // beyond max_shard_size is split at its median. Iteration must not overlap with put.
+    // range() and nearest(p, k) return iterators into a buffer owned by this set and the calling thread;
+    // the next call of the same kind on the same set from the same thread reuses it.
+    class PointSet {
+    public:
+
+        using ForwardIt = PointSetIterator;
+
+        static constexpr std::size_t default_max_shard_size = 1 << 16;
+
+        explicit PointSet(std::size_t max_shard_size = default_max_shard_size);
+
+        template <class InputIt>
+        PointSet(InputIt first, InputIt last, std::size_t max_shard_size = default_max_shard_size)
+                : m_max_shard_size(max_shard_size) { load(std::vector<Point>(first, last)); }
+
+        std::size_t shards() const;
+
+        bool empty() const;
+
+        std::size_t size() const;
+
+        void put(const Point &);
+
+        bool contains(const Point &) const;
+
+        // second iterator points to an element out of range; valid until this thread's next range() on this set
+        std::pair<ForwardIt, ForwardIt> range(const Rect &) const;
+
+        ForwardIt begin() const;
+
+        ForwardIt end() const;
+
+        std::optional<Point> nearest(const Point &) const;
+
+        // points are ordered by distance; second iterator points to an element out of range;
+        // valid until this thread's next nearest(p, k) on this set
+        std::pair<ForwardIt, ForwardIt> nearest(const Point &, std::size_t) const;
+
+        friend std::ostream &operator<<(std::ostream &, const PointSet &);
+
+    private:
+
+        std::size_t m_max_shard_size;
+        std::atomic<std::size_t> m_size{0};
+
+        // guards the directory and the shard list; shard contents are guarded by Shard::m_mutex
+        mutable std::shared_mutex m_directory_mutex{};
+        std::vector<Split> m_directory{};
+        std::vector<std::unique_ptr<Shard>> m_shards{};
+
+        void load(std::vector<Point> points);
+
+        void load(std::size_t split, std::unique_ptr<Shard> shard, std::vector<Point> &points,
+                  std::size_t first, std::size_t last);
+
+        std::size_t find(const Point &p) const;
+
+        void resplit(std::size_t shard);
+
+        void nearest(const Point &p, std::size_t k, std::priority_queue<std::pair<double, Point>> &heap) const;
+
+        struct Answers
+        {
+            std::vector<Point> m_range;
+            std::vector<Point> m_nearest;
+        };
+
+        // result buffers of each thread that has queried this set; entries are never erased, so
+        // references stay valid after the lock is released
+        mutable std::shared_mutex m_answers_mutex{};
+        mutable std::map<std::thread::id, Answers> m_answers{};
+
+        Answers &answers() const;
+
+    };
+
+}
@@ -50,6 +50,20 @@ namespace kdtree
         }
     }
 
+    void PointSet::load(std::vector<Point> &points, std::size_t first, std::size_t last, bool split)
+    {
+        if (first == last)
+        {
+            return;
+        }
+        std::size_t mid = first + (last - first) / 2;
+        std::nth_element(points.begin() + first, points.begin() + mid, points.begin() + last,
+                         [split](const Point &a, const Point &b) { return split ? a.x() < b.x() : a.y() < b.y(); });
+        put(points[mid]);
+        load(points, first, mid, !split);
+        load(points, mid + 1, last, !split);
+    }
+
     void PointSet::put(const std::shared_ptr<Node>& node, const Point &p, bool split, const std::shared_ptr<Node>& next_dfs) const
     {
         if ((node->m_split && p.x() < node->m_point.x()) || (!node->m_split && p.y() < node->m_point.y()))
@@ -115,56 +129,24 @@ namespace kdtree
         m_ans_range_root = nullptr;
         m_ans_range_begin = nullptr;
         m_ans_range_end = nullptr;
-        if (!empty())
-        {
-            range(m_root, rect);
-        }
-
-        range_cash.insert({range_count, {PointSetIterator(m_ans_range_begin), PointSetIterator(m_ans_range_end)}});
-        return {range_cash.find(range_count)->second.first, range_cash.find(range_count)->second.second};
-    }
-
-    void PointSet::range(const std::shared_ptr<Node>& node, const Rect &rect) const
-    {
-        if (node == nullptr)
-        {
-            return;
-        }
-
-        if (rect.contains(node->m_point))
-        {
+        visit_range(rect, [this](const Point &p) {
             if (m_ans_range_root == nullptr)
             {
-                m_ans_range_root = std::make_shared<Node>(node->m_point, true, m_ans_range_end);
+                m_ans_range_root = std::make_shared<Node>(p, true, m_ans_range_end);
                 m_ans_range_begin = m_ans_range_root;
             }
             else
             {
-                put(m_ans_range_root, node->m_point, true, m_ans_range_end);
+                put(m_ans_range_root, p, true, m_ans_range_end);
                 if (m_ans_range_begin->m_left != nullptr)
                 {
                     m_ans_range_begin = m_ans_range_begin->m_left;
                 }
             }
-        }
-
-        double min = (node->m_split) ? rect.xmin() : rect.ymin();
-        double max = (node->m_split) ? rect.xmax() : rect.ymax();
-        double coord = (node->m_split) ? node->m_point.x() : node->m_point.y();
-        if (min <= coord && coord <= max)
-        {
-            range(node->m_left, rect);
-            range(node->m_right, rect);
-        }
-        else if (min > coord)
-        {
-            range(node->m_right, rect);
-        }
-        else
-        {
-            range(node->m_left, rect);
-        }
+        });
 
+        range_cash.insert({range_count, {PointSetIterator(m_ans_range_begin), PointSetIterator(m_ans_range_end)}});
+        return {range_cash.find(range_count)->second.first, range_cash.find(range_count)->second.second};
     }
 
     PointSet::ForwardIt PointSet::begin() const
@@ -216,58 +198,64 @@ namespace kdtree
         m_ans_nearest_root = nullptr;
         m_ans_nearest_begin = nullptr;
         m_ans_nearest_end = nullptr;
-        std::map<double, std::shared_ptr<Node>> nodes;
-        nearest(m_root, true, nodes, std::numeric_limits<double>::max(), p, k, 0);
+        std::priority_queue<std::pair<double, Point>> nodes;
+        nearest(p, k, nodes);
 
-        auto it_ans = nodes.begin();
-        for (std::size_t i = 0; i < k; i++) {
-            if (it_ans == nodes.end())
-            {
-                break;
-            }
+        for (; !nodes.empty(); nodes.pop())
+        {
             if (m_ans_nearest_root == nullptr)
             {
-                m_ans_nearest_root = std::make_shared<Node>((*it_ans).second->m_point, true, m_ans_nearest_end);
+                m_ans_nearest_root = std::make_shared<Node>(nodes.top().second, true, m_ans_nearest_end);
                 m_ans_nearest_begin = m_ans_nearest_root;
             }
             else
             {
-                put(m_ans_nearest_root, (*it_ans).second->m_point, true, m_ans_nearest_end);
+                put(m_ans_nearest_root, nodes.top().second, true, m_ans_nearest_end);
                 if (m_ans_nearest_begin->m_left != nullptr)
                 {
                     m_ans_nearest_begin = m_ans_nearest_begin->m_left;
                 }
             }
-            it_ans++;
         }
 
         nearest_cash.insert({nearest_count, {PointSetIterator(m_ans_nearest_begin), PointSetIterator(m_ans_nearest_end)}});
         return {nearest_cash.find(nearest_count)->second.first, nearest_cash.find(nearest_count)->second.second};
     }
 
-    void PointSet::nearest(const std::shared_ptr<Node>& node, bool split, std::map<double, std::shared_ptr<Node>> &nodes,
-                           double closest, const Point &p, const std::size_t &k, size_t size) const
+    void PointSet::nearest(const Point &p, std::size_t k, std::priority_queue<std::pair<double, Point>> &nodes) const
+    {
+        if (k != 0)
+        {
+            nearest(m_root, nodes, p, k);
+        }
+    }
+
+    void PointSet::nearest(const std::shared_ptr<Node>& node, std::priority_queue<std::pair<double, Point>> &nodes,
+                           const Point &p, std::size_t k) const
     {
         if (node == nullptr)
             return;
         double temp_dist = p.distance(node->m_point);
-        if (closest > temp_dist)
+        if (nodes.size() < k)
         {
-            closest = temp_dist;
+            nodes.emplace(temp_dist, node->m_point);
+        }
+        else if (temp_dist < nodes.top().first)
+        {
+            nodes.pop();
+            nodes.emplace(temp_dist, node->m_point);
         }
-        nodes.insert({temp_dist, node});
-        size++;
 
-        double diff = split ? p.x() - node->m_point.x() : p.y() - node->m_point.y();
-        std::shared_ptr<Node> node1(diff < 0 ? (node->m_left ? node->m_left : nullptr) : (node->m_right ? node->m_right : nullptr));
-        std::shared_ptr<Node> node2(diff < 0 ? (node->m_right ? node->m_right : nullptr) : (node->m_left ? node->m_left : nullptr));
+        double diff = node->m_split ? p.x() - node->m_point.x() : p.y() - node->m_point.y();
+        const std::shared_ptr<Node> &node1 = diff < 0 ? node->m_left : node->m_right;
+        const std::shared_ptr<Node> &node2 = diff < 0 ? node->m_right : node->m_left;
 
-        nearest(node1, !split, nodes, closest, p, k, size);
-        if (diff < closest || size < k)
+        nearest(node1, nodes, p, k);
+        // the far side can only matter while it is closer than the k-th best candidate
+        if (nodes.size() < k || std::abs(diff) < nodes.top().first)
         {
-            nearest(node2, !split, nodes, closest, p, k, size);
+            nearest(node2, nodes, p, k);
         }
-
     }
 
     std::ostream &operator<<(std::ostream &os, const PointSet &p)
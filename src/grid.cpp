@@ -0,0 +1,591 @@
+#include "primitives.h"
+#include <iostream>
+#include <queue>
+#include <tuple>
+
+namespace
+{
+    // average occupancy the grid is sized for
+    const std::size_t points_per_cell = 2;
+    // points kept unindexed before the grid is first built
+    const std::size_t min_tail = 64;
+    // share of the points on each side that may fall outside the grid bounds
+    const double outlier_share = 0.001;
+
+    struct Layout
+    {
+        double xmin = 0;
+        double ymin = 0;
+        double xmax = 0;
+        double ymax = 0;
+        double cell_w = 1;
+        double cell_h = 1;
+        std::size_t nx = 1;
+        std::size_t ny = 1;
+    };
+
+    // Lower and upper outlier_share quantiles of the coordinates, NaNs ignored.
+    std::pair<double, double> quantiles(const std::vector<Point> &points, bool x)
+    {
+        std::vector<double> coords;
+        coords.reserve(points.size());
+        for (const auto &p : points)
+        {
+            double c = x ? p.x() : p.y();
+            if (!std::isnan(c)) coords.push_back(c);
+        }
+        if (coords.empty())
+        {
+            return {0, 0};
+        }
+        auto cut = static_cast<std::size_t>(coords.size() * outlier_share);
+        std::nth_element(coords.begin(), coords.begin() + cut, coords.end());
+        double low = coords[cut];
+        std::nth_element(coords.begin(), coords.end() - 1 - cut, coords.end());
+        return {low, coords[coords.size() - 1 - cut]};
+    }
+
+    // About `cells` square-ish cells over the quantile box of the points, so that a few far
+    // outliers cannot stretch the grid. Each axis is capped at the total cell count so that very
+    // thin data does not blow up the grid.
+    Layout make_layout(const std::vector<Point> &points, std::size_t cells)
+    {
+        Layout l;
+        if (points.empty())
+        {
+            return l;
+        }
+        std::tie(l.xmin, l.xmax) = quantiles(points, true);
+        std::tie(l.ymin, l.ymax) = quantiles(points, false);
+
+        cells = std::max<std::size_t>(1, cells);
+        double w = l.xmax - l.xmin;
+        double h = l.ymax - l.ymin;
+        if (w > 0 && h > 0)
+        {
+            double side = std::sqrt(w * h / cells);
+            l.nx = std::min<std::size_t>(cells, std::max(1.0, std::ceil(w / side)));
+            l.ny = std::min<std::size_t>(cells, std::max(1.0, std::ceil(h / side)));
+        }
+        else if (w > 0)
+        {
+            l.nx = cells;
+        }
+        else if (h > 0)
+        {
+            l.ny = cells;
+        }
+        if (w > 0) l.cell_w = w / l.nx;
+        if (h > 0) l.cell_h = h / l.ny;
+        return l;
+    }
+
+    std::size_t cell_index(double coord, double min, double cell, std::size_t n)
+    {
+        double i = std::floor((coord - min) / cell);
+        if (!(i > 0)) return 0; // also catches NaN
+        return std::min(static_cast<std::size_t>(i), n - 1);
+    }
+
+    double distance2(const Point &a, const Point &b)
+    {
+        double dx = a.x() - b.x();
+        double dy = a.y() - b.y();
+        return dx * dx + dy * dy;
+    }
+}
+
+namespace grid
+{
+
+    bool PointSet::empty() const
+    {
+        return m_points.empty();
+    }
+
+    std::size_t PointSet::size() const
+    {
+        return m_points.size();
+    }
+
+    void PointSet::build(bool dedup)
+    {
+        if (dedup)
+        {
+            std::sort(m_points.begin(), m_points.end());
+            m_points.erase(std::unique(m_points.begin(), m_points.end()), m_points.end());
+        }
+
+        Layout l = make_layout(m_points, m_points.size() / points_per_cell);
+        m_xmin = l.xmin;
+        m_ymin = l.ymin;
+        m_xmax = l.xmax;
+        m_ymax = l.ymax;
+        m_cell_w = l.cell_w;
+        m_cell_h = l.cell_h;
+        m_nx = l.nx;
+        m_ny = l.ny;
+
+        // counting sort of the points into their cells, points outside the grid go last
+        std::vector<std::size_t> cells;
+        cells.reserve(m_points.size());
+        m_cell_start.assign(m_nx * m_ny + 1, 0);
+        std::vector<Point> outside;
+        for (const auto &p : m_points)
+        {
+            if (!inside(p))
+            {
+                cells.push_back(npos);
+                outside.push_back(p);
+                continue;
+            }
+            cells.push_back(cell(p));
+            m_cell_start[cells.back() + 1]++;
+        }
+        for (std::size_t i = 1; i < m_cell_start.size(); i++)
+        {
+            m_cell_start[i] += m_cell_start[i - 1];
+        }
+        std::vector<std::size_t> pos(m_cell_start.begin(), m_cell_start.end() - 1);
+        std::vector<std::size_t> order(m_points.size());
+        std::size_t next_outside = m_cell_start.back();
+        for (std::size_t i = 0; i < m_points.size(); i++)
+        {
+            order[cells[i] == npos ? next_outside++ : pos[cells[i]]++] = i;
+        }
+        std::vector<Point> sorted;
+        sorted.reserve(m_points.size());
+        for (std::size_t i : order)
+        {
+            sorted.push_back(m_points[i]);
+        }
+        m_points.swap(sorted);
+        m_indexed = m_points.size();
+        m_overflow_head.assign(m_nx * m_ny, npos);
+        m_overflow_next.clear();
+        m_outside = std::make_unique<kdtree::PointSet>(outside.begin(), outside.end());
+    }
+
+    bool PointSet::inside(const Point &p) const
+    {
+        return p.x() >= m_xmin && p.x() <= m_xmax && p.y() >= m_ymin && p.y() <= m_ymax;
+    }
+
+    std::size_t PointSet::cell(const Point &p) const
+    {
+        return cell_index(p.y(), m_ymin, m_cell_h, m_ny) * m_nx + cell_index(p.x(), m_xmin, m_cell_w, m_nx);
+    }
+
+    template <class Visit>
+    void PointSet::visit_cell(std::size_t cell, Visit visit) const
+    {
+        for (std::size_t i = m_cell_start[cell]; i < m_cell_start[cell + 1]; i++)
+        {
+            visit(m_points[i]);
+        }
+        for (std::size_t i = m_overflow_head[cell]; i != npos; i = m_overflow_next[i - m_indexed])
+        {
+            visit(m_points[i]);
+        }
+    }
+
+    void PointSet::put(const Point &p)
+    {
+        if (contains(p))
+        {
+            return;
+        }
+        m_points.push_back(p);
+        if (m_indexed == 0)
+        {
+            if (m_points.size() > min_tail)
+            {
+                build(false);
+            }
+            return;
+        }
+        if (inside(p))
+        {
+            std::size_t c = cell(p);
+            m_overflow_next.push_back(m_overflow_head[c]);
+            m_overflow_head[c] = m_points.size() - 1;
+        }
+        else
+        {
+            m_overflow_next.push_back(npos);
+            m_outside->put(p);
+        }
+        if (m_overflow_next.size() > m_indexed)
+        {
+            build(false);
+        }
+    }
+
+    bool PointSet::contains(const Point &p) const
+    {
+        if (m_indexed == 0)
+        {
+            return std::find(m_points.begin(), m_points.end(), p) != m_points.end();
+        }
+        if (!inside(p))
+        {
+            return m_outside->contains(p);
+        }
+        bool found = false;
+        visit_cell(cell(p), [&](const Point &q) { found = found || q == p; });
+        return found;
+    }
+
+    std::pair<PointSet::ForwardIt, PointSet::ForwardIt> PointSet::range(const Rect &rect) const
+    {
+        auto inside_rect = [&rect](const Point &p) { return rect.contains(p); };
+        m_ans_range.clear();
+        if (m_indexed == 0)
+        {
+            std::copy_if(m_points.begin(), m_points.end(), std::back_inserter(m_ans_range), inside_rect);
+        }
+        else if (rect.xmin() <= m_xmax && rect.xmax() >= m_xmin && rect.ymin() <= m_ymax && rect.ymax() >= m_ymin)
+        {
+            std::size_t x0 = cell_index(rect.xmin(), m_xmin, m_cell_w, m_nx);
+            std::size_t x1 = cell_index(rect.xmax(), m_xmin, m_cell_w, m_nx);
+            std::size_t y0 = cell_index(rect.ymin(), m_ymin, m_cell_h, m_ny);
+            std::size_t y1 = cell_index(rect.ymax(), m_ymin, m_cell_h, m_ny);
+            for (std::size_t y = y0; y <= y1; y++)
+            {
+                // cells of one grid row are contiguous in m_points
+                auto first = m_points.begin() + m_cell_start[y * m_nx + x0];
+                auto last = m_points.begin() + m_cell_start[y * m_nx + x1 + 1];
+                std::copy_if(first, last, std::back_inserter(m_ans_range), inside_rect);
+                for (std::size_t x = x0; x <= x1; x++)
+                {
+                    for (std::size_t i = m_overflow_head[y * m_nx + x]; i != npos; i = m_overflow_next[i - m_indexed])
+                    {
+                        if (inside_rect(m_points[i])) m_ans_range.push_back(m_points[i]);
+                    }
+                }
+            }
+        }
+        if (m_indexed != 0 && !(rect.xmin() >= m_xmin && rect.xmax() <= m_xmax && rect.ymin() >= m_ymin &&
+                                rect.ymax() <= m_ymax))
+        {
+            m_outside->visit_range(rect, [this](const Point &p) { m_ans_range.push_back(p); });
+        }
+        return {m_ans_range.cbegin(), m_ans_range.cend()};
+    }
+
+    PointSet::ForwardIt PointSet::begin() const
+    {
+        return m_points.begin();
+    }
+
+    PointSet::ForwardIt PointSet::end() const
+    {
+        return m_points.end();
+    }
+
+    // Calls visit(point) for the points of the grid ring by ring around the cell of p, or for every
+    // point while the grid is not built yet. After each ring the walk computes a lower bound on the
+    // distance from p to the unvisited cells and stops once done(bound) accepts it or every cell has
+    // been visited. The bound is geometric because p may lie far outside the grid, where the rings
+    // grow much slower than the distance to the cells they reach.
+    template <class Visit, class Done>
+    void PointSet::visit_rings(const Point &p, Visit visit, Done done) const
+    {
+        if (m_indexed == 0)
+        {
+            std::for_each(m_points.begin(), m_points.end(), visit);
+            return;
+        }
+        auto cx = static_cast<std::ptrdiff_t>(cell_index(p.x(), m_xmin, m_cell_w, m_nx));
+        auto cy = static_cast<std::ptrdiff_t>(cell_index(p.y(), m_ymin, m_cell_h, m_ny));
+        auto nx = static_cast<std::ptrdiff_t>(m_nx);
+        auto ny = static_cast<std::ptrdiff_t>(m_ny);
+        std::ptrdiff_t max_r = std::max({cx, nx - 1 - cx, cy, ny - 1 - cy});
+        // distance from p to the grid along each axis
+        double dx = std::max({m_xmin - p.x(), 0.0, p.x() - m_xmax});
+        double dy = std::max({m_ymin - p.y(), 0.0, p.y() - m_ymax});
+
+        auto visit_xy = [&](std::ptrdiff_t x, std::ptrdiff_t y) {
+            if (x < 0 || x >= nx || y < 0 || y >= ny) return;
+            visit_cell(y * m_nx + x, visit);
+        };
+
+        for (std::ptrdiff_t r = 0; r <= max_r; r++)
+        {
+            if (r == 0)
+            {
+                visit_xy(cx, cy);
+            }
+            else
+            {
+                for (std::ptrdiff_t x = cx - r; x <= cx + r; x++)
+                {
+                    visit_xy(x, cy - r);
+                    visit_xy(x, cy + r);
+                }
+                for (std::ptrdiff_t y = cy - r + 1; y <= cy + r - 1; y++)
+                {
+                    visit_xy(cx - r, y);
+                    visit_xy(cx + r, y);
+                }
+            }
+            // unvisited cells lie past a side of the visited block that has not reached the grid edge
+            double bound = std::numeric_limits<double>::infinity();
+            auto side = [&bound](double gap, double across) {
+                gap = std::max(gap, 0.0);
+                bound = std::min(bound, std::sqrt(gap * gap + across * across));
+            };
+            if (cx - r > 0) side(p.x() - (m_xmin + (cx - r) * m_cell_w), dy);
+            if (cx + r < nx - 1) side(m_xmin + (cx + r + 1) * m_cell_w - p.x(), dy);
+            if (cy - r > 0) side(p.y() - (m_ymin + (cy - r) * m_cell_h), dx);
+            if (cy + r < ny - 1) side(m_ymin + (cy + r + 1) * m_cell_h - p.y(), dx);
+            if (done(bound))
+            {
+                return;
+            }
+        }
+    }
+
+    // Merges the k nearest points into a max-heap of (distance, point) holding at most k entries.
+    void PointSet::nearest(const Point &p, std::size_t k, std::priority_queue<std::pair<double, Point>> &heap) const
+    {
+        bool in_grid = m_indexed == 0 || inside(p);
+        if (!in_grid)
+        {
+            // the points outside the grid are likely the closest ones; they tighten the bound early
+            m_outside->nearest(p, k, heap);
+        }
+        auto visit = [&](const Point &q) {
+            double d = p.distance(q);
+            if (heap.size() < k)
+            {
+                heap.emplace(d, q);
+            }
+            else if (d < heap.top().first)
+            {
+                heap.pop();
+                heap.emplace(d, q);
+            }
+        };
+        visit_rings(p, visit, [&](double bound) { return heap.size() == k && heap.top().first <= bound; });
+        // from inside, the points outside the grid are at least as far as its nearest edge
+        double edge = std::min({p.x() - m_xmin, m_xmax - p.x(), p.y() - m_ymin, m_ymax - p.y()});
+        if (in_grid && m_indexed != 0 && (heap.size() < k || heap.top().first > edge))
+        {
+            m_outside->nearest(p, k, heap);
+        }
+    }
+
+    std::optional<Point> PointSet::nearest(const Point &p) const
+    {
+        if (empty())
+        {
+            return {};
+        }
+        std::priority_queue<std::pair<double, Point>> heap;
+        if (m_indexed != 0 && !inside(p))
+        {
+            nearest(p, 1, heap);
+            return heap.top().second;
+        }
+
+        // same walk as nearest(p, k, heap) without the heap, this is the common query
+        const Point *best = nullptr;
+        double best_dist = std::numeric_limits<double>::max();
+        auto visit = [&](const Point &q) {
+            double d = distance2(p, q);
+            if (best == nullptr || d < best_dist)
+            {
+                best_dist = d;
+                best = &q;
+            }
+        };
+        visit_rings(p, visit, [&](double bound) { return best != nullptr && best_dist <= bound * bound; });
+        double edge = std::min({p.x() - m_xmin, m_xmax - p.x(), p.y() - m_ymin, m_ymax - p.y()});
+        if (m_indexed != 0 && (best == nullptr || best_dist > edge * edge))
+        {
+            if (best != nullptr) heap.emplace(std::sqrt(best_dist), *best);
+            m_outside->nearest(p, 1, heap);
+            return heap.top().second;
+        }
+        return *best;
+    }
+
+    std::pair<PointSet::ForwardIt, PointSet::ForwardIt> PointSet::nearest(const Point &p, std::size_t k) const
+    {
+        std::priority_queue<std::pair<double, Point>> heap;
+        if (k != 0)
+        {
+            nearest(p, k, heap);
+        }
+
+        m_ans_nearest.clear();
+        for (; !heap.empty(); heap.pop())
+        {
+            m_ans_nearest.push_back(heap.top().second);
+        }
+        std::reverse(m_ans_nearest.begin(), m_ans_nearest.end());
+        return {m_ans_nearest.cbegin(), m_ans_nearest.cend()};
+    }
+
+    std::ostream &operator<<(std::ostream &os, const PointSet &p)
+    {
+        for (const auto &point : p)
+        {
+            os << point << std::endl;
+        }
+        return os;
+    }
+}
+
+namespace adaptive
+{
+
+    namespace
+    {
+        // number of points looked at when choosing the backend
+        const std::size_t sample_size = 4096;
+        // below this size a tree is as fast as a grid
+        const std::size_t min_grid_size = 1024;
+        // sample points per histogram cell; a uniform sample leaves about e^-4 ~ 2% of cells empty
+        const std::size_t sample_per_cell = 4;
+        const double max_empty_cells = 0.2;
+    }
+
+    PointSet::PointSet() : m_kdtree(std::make_unique<kdtree::PointSet>()) {}
+
+    // The histogram covers the quantile box of all points, as the grid would, so that outliers
+    // missed by the sample cannot hide an empty grid.
+    Backend PointSet::choose(const std::vector<Point> &points)
+    {
+        if (points.size() < min_grid_size)
+        {
+            return Backend::KdTree;
+        }
+
+        // evenly strided sample, so that sorted input is still sampled over its whole extent
+        std::vector<Point> sample;
+        std::size_t step = std::max<std::size_t>(1, points.size() / sample_size);
+        for (std::size_t i = 0; i < points.size(); i += step)
+        {
+            sample.push_back(points[i]);
+        }
+
+        Layout l = make_layout(points, sample.size() / sample_per_cell);
+        if (l.xmax == l.xmin || l.ymax == l.ymin)
+        {
+            return Backend::KdTree;
+        }
+        std::vector<std::size_t> histogram(l.nx * l.ny, 0);
+        for (const auto &p : sample)
+        {
+            histogram[cell_index(p.y(), l.ymin, l.cell_h, l.ny) * l.nx + cell_index(p.x(), l.xmin, l.cell_w, l.nx)]++;
+        }
+        auto empty_cells = static_cast<double>(std::count(histogram.begin(), histogram.end(), 0));
+        return empty_cells <= max_empty_cells * histogram.size() ? Backend::Grid : Backend::KdTree;
+    }
+
+    void PointSet::load(std::vector<Point> points)
+    {
+        if (choose(points) == Backend::Grid)
+        {
+            m_kdtree.reset();
+            m_grid = std::make_unique<grid::PointSet>(points.begin(), points.end());
+        }
+        else
+        {
+            m_grid.reset();
+            m_kdtree = std::make_unique<kdtree::PointSet>(points.begin(), points.end());
+        }
+        m_chosen_size = size();
+    }
+
+    Backend PointSet::backend() const
+    {
+        return m_grid ? Backend::Grid : Backend::KdTree;
+    }
+
+    bool PointSet::empty() const
+    {
+        return m_grid ? m_grid->empty() : m_kdtree->empty();
+    }
+
+    std::size_t PointSet::size() const
+    {
+        return m_grid ? m_grid->size() : m_kdtree->size();
+    }
+
+    void PointSet::put(const Point &p)
+    {
+        if (m_grid)
+        {
+            m_grid->put(p);
+        }
+        else
+        {
+            m_kdtree->put(p);
+        }
+        // the data may have drifted since the last choice; check again each time the set doubles,
+        // which is also when the grid rebuilds itself
+        if (size() >= min_grid_size && size() >= 2 * m_chosen_size)
+        {
+            std::vector<Point> points(begin(), end());
+            if (choose(points) != backend())
+            {
+                load(std::move(points));
+            }
+            m_chosen_size = size();
+        }
+    }
+
+    bool PointSet::contains(const Point &p) const
+    {
+        return m_grid ? m_grid->contains(p) : m_kdtree->contains(p);
+    }
+
+    std::pair<PointSet::ForwardIt, PointSet::ForwardIt> PointSet::range(const Rect &rect) const
+    {
+        if (m_grid)
+        {
+            auto ans = m_grid->range(rect);
+            return {PointSetIterator(ans.first), PointSetIterator(ans.second)};
+        }
+        auto ans = m_kdtree->range(rect);
+        return {PointSetIterator(ans.first), PointSetIterator(ans.second)};
+    }
+
+    PointSet::ForwardIt PointSet::begin() const
+    {
+        return m_grid ? PointSetIterator(m_grid->begin()) : PointSetIterator(m_kdtree->begin());
+    }
+
+    PointSet::ForwardIt PointSet::end() const
+    {
+        return m_grid ? PointSetIterator(m_grid->end()) : PointSetIterator(m_kdtree->end());
+    }
+
+    std::optional<Point> PointSet::nearest(const Point &p) const
+    {
+        return m_grid ? m_grid->nearest(p) : m_kdtree->nearest(p);
+    }
+
+    std::pair<PointSet::ForwardIt, PointSet::ForwardIt> PointSet::nearest(const Point &p, std::size_t k) const
+    {
+        if (m_grid)
+        {
+            auto ans = m_grid->nearest(p, k);
+            return {PointSetIterator(ans.first), PointSetIterator(ans.second)};
+        }
+        auto ans = m_kdtree->nearest(p, k);
+        return {PointSetIterator(ans.first), PointSetIterator(ans.second)};
+    }
+
+    std::ostream &operator<<(std::ostream &os, const PointSet &p)
+    {
+        for (const auto &point : p)
+        {
+            os << point << std::endl;
+        }
+        return os;
+    }
+}
@@ -1,106 +1,589 @@
 #include "primitives.h"
 
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <string>
+#include <thread>
 
-int main()
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char *usage =
+            "usage: 2dtree --points FILE [--format csv|bin] [--queries FILE]\n"
+            "              [--backend kdtree|rbtree|grid|adaptive|sharded] [--threads N]\n"
+            "       2dtree --verify\n"
+            "\n"
+            "points:  csv, one \"x,y\" per line after an optional header line,\n"
+            "         or bin, packed native-endian double pairs; *.bin files default to bin\n"
+            "queries: one operation per line, fields separated by spaces or commas\n"
+            "           c x y            contains\n"
+            "           r x0 y0 x1 y1    range\n"
+            "           n x y            nearest\n"
+            "           k x y K          K nearest\n"
+            "           p x y            put\n"
+            "threads: more than one replay thread needs the sharded backend\n"
+            "memory:  kdtree and rbtree keep every range and K-nearest result (so does adaptive when it\n"
+            "         picks a kd-tree); their memory grows with the trace, grid and sharded do not\n"
+            "verify:  checks the kdtree, grid, adaptive and sharded sets against brute force\n";
+
+    // Read-only memory mapping of a whole file.
+    class MappedFile
+    {
+    public:
+
+        explicit MappedFile(const std::string &path)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return;
+            }
+            struct stat st{};
+            if (::fstat(fd, &st) == 0)
+            {
+                if (st.st_size == 0)
+                {
+                    m_data = ""; // mmap rejects empty mappings
+                }
+                else
+                {
+                    void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (data != MAP_FAILED)
+                    {
+                        ::madvise(data, st.st_size, MADV_SEQUENTIAL);
+                        m_data = static_cast<const char *>(data);
+                        m_size = st.st_size;
+                    }
+                }
+            }
+            ::close(fd);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile()
+        {
+            if (m_size != 0) ::munmap(const_cast<char *>(m_data), m_size);
+        }
+
+        bool ok() const { return m_data != nullptr; }
+
+        const char *begin() const { return m_data; }
+
+        const char *end() const { return m_data + m_size; }
+
+        std::size_t size() const { return m_size; }
+
+    private:
+        const char *m_data = nullptr;
+        std::size_t m_size = 0;
+    };
+
+    bool is_separator(char c)
+    {
+        return c == ' ' || c == ',' || c == ';' || c == '\t' || c == '\r';
+    }
+
+    // Parses the next number of the current line in place; never crosses a line break.
+    template <class T>
+    bool parse(const char *&it, const char *end, T &value)
+    {
+        while (it != end && is_separator(*it)) it++;
+        auto result = std::from_chars(it, end, value);
+        if (result.ec != std::errc())
+        {
+            return false;
+        }
+        it = result.ptr;
+        return true;
+    }
+
+    const char *next_line(const char *it, const char *end)
+    {
+        auto eol = static_cast<const char *>(std::memchr(it, '\n', end - it));
+        return eol ? eol + 1 : end;
+    }
+
+    // Fails if nothing parses or if a line other than the first (a header) does not parse.
+    bool load_csv(const MappedFile &file, std::vector<Point> &points)
+    {
+        std::size_t line_number = 0, skipped = 0, first_bad = 0;
+        for (const char *line = file.begin(); line != file.end(); line = next_line(line, file.end()))
+        {
+            line_number++;
+            const char *it = line;
+            while (it != file.end() && is_separator(*it)) it++;
+            if (it == file.end() || *it == '\n')
+            {
+                continue;
+            }
+            double x, y;
+            if (parse(it, file.end(), x) && parse(it, file.end(), y))
+            {
+                points.emplace_back(x, y);
+            }
+            else if (skipped++ == 0)
+            {
+                first_bad = line_number;
+            }
+        }
+        if (skipped != 0)
+        {
+            std::cerr << "points: skipped " << skipped << " line(s) that do not parse, the first is line "
+                      << first_bad << std::endl;
+        }
+        if (points.empty() || skipped > 1 || (skipped == 1 && first_bad != 1))
+        {
+            std::cerr << "points: " << (points.empty() ? "no point parses" : "only a header line may be skipped")
+                      << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<Point> load_binary(const MappedFile &file)
+    {
+        std::vector<Point> points;
+        points.reserve(file.size() / (2 * sizeof(double)));
+        for (const char *it = file.begin(); file.end() - it >= static_cast<std::ptrdiff_t>(2 * sizeof(double));
+             it += 2 * sizeof(double))
+        {
+            double xy[2];
+            std::memcpy(xy, it, sizeof(xy)); // the mapping gives no alignment guarantee
+            points.emplace_back(xy[0], xy[1]);
+        }
+        return points;
+    }
+
+    enum Op { Contains, Range, Nearest, NearestK, Put, OpCount };
+
+    const char *op_names[OpCount] = {"contains", "range", "nearest", "nearest-k", "put"};
+
+    struct Query
+    {
+        Op m_op;
+        Point m_a;
+        Point m_b;
+        std::size_t m_k;
+    };
+
+    bool load_queries(const MappedFile &file, std::vector<Query> &queries)
+    {
+        std::size_t line_number = 0;
+        for (const char *line = file.begin(); line != file.end(); line = next_line(line, file.end()))
+        {
+            line_number++;
+            const char *it = line;
+            while (it != file.end() && is_separator(*it)) it++;
+            if (it == file.end() || *it == '\n' || *it == '#')
+            {
+                continue;
+            }
+            char op = *it++;
+            double x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+            std::size_t k = 0;
+            bool ok = parse(it, file.end(), x0) && parse(it, file.end(), y0);
+            switch (op)
+            {
+                case 'c': queries.push_back({Contains, Point(x0, y0), Point(0, 0), 0}); break;
+                case 'n': queries.push_back({Nearest, Point(x0, y0), Point(0, 0), 0}); break;
+                case 'p': queries.push_back({Put, Point(x0, y0), Point(0, 0), 0}); break;
+                case 'k':
+                    ok = ok && parse(it, file.end(), k);
+                    queries.push_back({NearestK, Point(x0, y0), Point(0, 0), k});
+                    break;
+                case 'r':
+                    ok = ok && parse(it, file.end(), x1) && parse(it, file.end(), y1);
+                    queries.push_back({Range, Point(x0, y0), Point(x1, y1), 0});
+                    break;
+                default: ok = false;
+            }
+            if (!ok)
+            {
+                std::cerr << "queries: cannot parse line " << line_number << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct Stats
+    {
+        std::vector<double> m_latency[OpCount]; // nanoseconds
+        std::size_t m_checksum = 0;
+    };
+
+    template <class Set>
+    void replay(Set &set, const std::vector<Query> &queries, std::size_t first, std::size_t step, Stats &stats)
+    {
+        using clock = std::chrono::steady_clock;
+        for (std::size_t i = first; i < queries.size(); i += step)
+        {
+            const Query &q = queries[i];
+            auto start = clock::now();
+            switch (q.m_op)
+            {
+                case Contains:
+                    stats.m_checksum += set.contains(q.m_a);
+                    break;
+                case Range:
+                {
+                    auto ans = set.range(Rect(q.m_a, q.m_b));
+                    stats.m_checksum += std::distance(ans.first, ans.second);
+                    break;
+                }
+                case Nearest:
+                    stats.m_checksum += set.nearest(q.m_a).has_value();
+                    break;
+                case NearestK:
+                {
+                    auto ans = set.nearest(q.m_a, q.m_k);
+                    stats.m_checksum += std::distance(ans.first, ans.second);
+                    break;
+                }
+                case Put:
+                    set.put(q.m_a);
+                    break;
+                case OpCount:
+                    break;
+            }
+            stats.m_latency[q.m_op].push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count());
+        }
+    }
+
+    double percentile(const std::vector<double> &sorted, double p)
+    {
+        return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+    }
+
+    template <class Set>
+    void run(Set &set, const std::vector<Query> &queries, std::size_t threads)
+    {
+        std::vector<Stats> stats(threads);
+        auto start = std::chrono::steady_clock::now();
+        if (threads == 1)
+        {
+            replay(set, queries, 0, 1, stats[0]);
+        }
+        else
+        {
+            std::vector<std::thread> workers;
+            for (std::size_t t = 0; t < threads; t++)
+            {
+                workers.emplace_back([&, t] { replay(set, queries, t, threads, stats[t]); });
+            }
+            for (auto &worker : workers)
+            {
+                worker.join();
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::size_t checksum = 0;
+        for (const auto &s : stats) checksum += s.m_checksum;
+        std::cout << "replayed " << queries.size() << " queries on " << threads << " thread(s) in " << seconds
+                  << " s, " << queries.size() / seconds << " ops/s, checksum " << checksum << std::endl;
+        std::cout << std::left << std::setw(12) << "op" << std::right << std::setw(12) << "count"
+                  << std::setw(14) << "ops/s" << std::setw(14) << "ops/s/thread" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us"
+                  << std::setw(12) << "p999 us" << std::endl;
+        for (int op = 0; op < OpCount; op++)
+        {
+            std::vector<double> latency;
+            for (const auto &s : stats) latency.insert(latency.end(), s.m_latency[op].begin(), s.m_latency[op].end());
+            if (latency.empty())
+            {
+                continue;
+            }
+            std::sort(latency.begin(), latency.end());
+            double busy = 0;
+            for (double l : latency) busy += l;
+            // ops/s is this operation's share of the replay throughput, ops/s/thread the rate of one
+            // thread doing only this operation
+            std::cout << std::left << std::setw(12) << op_names[op] << std::right << std::setw(12) << latency.size()
+                      << std::setw(14) << std::fixed << std::setprecision(0) << latency.size() / seconds
+                      << std::setw(14) << latency.size() / (busy * 1e-9)
+                      << std::setprecision(3) << std::setw(12) << percentile(latency, 0.5) * 1e-3
+                      << std::setw(12) << percentile(latency, 0.99) * 1e-3
+                      << std::setw(12) << percentile(latency, 0.999) * 1e-3 << std::defaultfloat << std::endl;
+        }
+    }
+
+    template <class Set>
+    void load_and_run(const std::vector<Point> &points, const std::vector<Query> &queries, std::size_t threads)
+    {
+        auto start = std::chrono::steady_clock::now();
+        Set set(points.begin(), points.end());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "built " << set.size() << " points in " << seconds << " s" << std::endl;
+        if (!queries.empty())
+        {
+            run(set, queries, threads);
+        }
+    }
+
+    // Brute-force answers over the distinct points, for --verify.
+    struct Reference
+    {
+        std::vector<Point> m_points;
+
+        explicit Reference(std::vector<Point> points) : m_points(std::move(points))
+        {
+            std::sort(m_points.begin(), m_points.end());
+            m_points.erase(std::unique(m_points.begin(), m_points.end()), m_points.end());
+        }
+
+        std::vector<Point> range(const Rect &rect) const
+        {
+            std::vector<Point> ans;
+            std::copy_if(m_points.begin(), m_points.end(), std::back_inserter(ans),
+                         [&rect](const Point &p) { return rect.contains(p); });
+            return ans;
+        }
+
+        // distance of the k-th nearest point, which does not depend on how ties are broken
+        double kth_distance(const Point &p, std::size_t k) const
+        {
+            std::vector<double> d;
+            for (const auto &q : m_points) d.push_back(q.distance(p));
+            std::sort(d.begin(), d.end());
+            return k == 0 || d.empty() ? 0 : d[std::min(k, d.size()) - 1];
+        }
+    };
+
+    template <class It>
+    std::vector<Point> sorted(It first, It last)
+    {
+        std::vector<Point> points(first, last);
+        std::sort(points.begin(), points.end());
+        return points;
+    }
+
+    // Compares every query of `set` with the reference; returns the number of mismatches.
+    template <class Set>
+    std::size_t check(const Set &set, const Reference &ref, const std::vector<Point> &probes)
+    {
+        std::size_t errors = 0;
+        errors += set.size() != ref.m_points.size();
+        errors += sorted(set.begin(), set.end()) != ref.m_points;
+        for (std::size_t i = 0; i < probes.size(); i++)
+        {
+            const Point &p = probes[i];
+            const Point &member = ref.m_points[i * 7919 % ref.m_points.size()];
+            errors += !set.contains(member);
+            errors += set.contains(p) != std::binary_search(ref.m_points.begin(), ref.m_points.end(), p);
+
+            const Point &q = probes[(i + 1) % probes.size()];
+            Rect rect(Point(std::min(p.x(), q.x()), std::min(p.y(), q.y())),
+                      Point(std::max(p.x(), q.x()), std::max(p.y(), q.y())));
+            auto range = set.range(rect);
+            errors += sorted(range.first, range.second) != ref.range(rect);
+
+            auto nearest = set.nearest(p);
+            errors += !nearest || nearest->distance(p) != ref.kth_distance(p, 1);
+
+            std::size_t k = i % 2 ? i % 17 : ref.m_points.size();
+            auto knn = set.nearest(p, k);
+            auto points = sorted(knn.first, knn.second);
+            double farthest = 0;
+            for (const auto &point : points) farthest = std::max(farthest, point.distance(p));
+            errors += points.size() != std::min(k, ref.m_points.size());
+            errors += std::adjacent_find(points.begin(), points.end()) != points.end();
+            errors += k != 0 && farthest != ref.kth_distance(p, k);
+        }
+        return errors;
+    }
+
+    template <class Set>
+    bool verify(const std::string &name, const std::string &data, const std::vector<Point> &points,
+                const std::vector<Point> &probes)
+    {
+        // bulk-load half, put the rest so that both paths are exercised
+        Set set(points.begin(), points.begin() + points.size() / 2);
+        for (auto it = points.begin() + points.size() / 2; it != points.end(); ++it)
+        {
+            set.put(*it);
+        }
+        std::size_t errors = check(set, Reference(points), probes);
+        std::cout << std::left << std::setw(10) << name << std::setw(10) << data
+                  << (errors ? std::to_string(errors) + " errors" : "ok") << std::endl;
+        return errors == 0;
+    }
+
+    // Concurrent put + contains on a sharded set small enough to re-split many times.
+    bool verify_concurrent(const std::vector<Point> &points, const std::vector<Point> &probes, std::size_t threads)
+    {
+        sharded::PointSet set(64);
+        std::atomic<std::size_t> errors{0};
+        std::vector<std::thread> workers;
+        for (std::size_t t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t] {
+                for (std::size_t i = t; i < points.size(); i += threads)
+                {
+                    set.put(points[i]);
+                    errors += !set.contains(points[i]);
+                    set.nearest(points[i], 3);
+                }
+            });
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        errors += set.shards() < 2;
+        errors += check(set, Reference(points), probes);
+        std::cout << std::left << std::setw(10) << "sharded" << std::setw(10) << "threads"
+                  << (errors ? std::to_string(errors) + " errors" : "ok") << " (" << set.shards() << " shards)" << std::endl;
+        return errors == 0;
+    }
+
+    bool verify()
+    {
+        std::mt19937 gen(2024);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        std::normal_distribution<double> normal(0, 0.01);
+        std::uniform_int_distribution<int> lattice(0, 40);
+
+        std::vector<std::pair<std::string, std::vector<Point>>> datasets(4);
+        datasets[0].first = "uniform";
+        datasets[1].first = "clusters";
+        datasets[2].first = "lattice"; // integer coordinates, many equal distances
+        datasets[3].first = "tiny";
+        for (int i = 0; i < 5000; i++)
+        {
+            datasets[0].second.emplace_back(uniform(gen), uniform(gen));
+            datasets[1].second.emplace_back(0.2 + 0.3 * (i % 3) + normal(gen), 0.5 + normal(gen));
+            datasets[2].second.emplace_back(lattice(gen), lattice(gen));
+        }
+        for (int i = 0; i < 10; i++)
+        {
+            datasets[3].second.emplace_back(i % 4, i / 4);
+        }
+
+        bool ok = true;
+        for (const auto &[data, points] : datasets)
+        {
+            double scale = data == "lattice" ? 40 : data == "tiny" ? 4 : 1;
+            std::vector<Point> probes;
+            for (int i = 0; i < 200; i++)
+            {
+                // integer probes on the lattice so that ties are common
+                double x = (uniform(gen) * 1.2 - 0.1) * scale, y = (uniform(gen) * 1.2 - 0.1) * scale;
+                probes.emplace_back(scale == 1 ? x : std::round(x), scale == 1 ? y : std::round(y));
+            }
+            ok &= verify<kdtree::PointSet>("kdtree", data, points, probes);
+            ok &= verify<grid::PointSet>("grid", data, points, probes);
+            ok &= verify<adaptive::PointSet>("adaptive", data, points, probes);
+            ok &= verify<sharded::PointSet>("sharded", data, points, probes);
+            if (data == "lattice")
+            {
+                ok &= verify_concurrent(points, probes, 4);
+            }
+        }
+        return ok;
+    }
+}
+
+int main(int argc, char *argv[])
 {
-    kdtree::PointSet p{};
-    if (p.empty()) std::cout << "PointSet is empty" << std::endl;
-    std::cout << p.size() << std::endl;
-
-    p.put(Point(0, 0));
-    p.put(Point(1., 1.));
-    p.put(Point(.4, .4));
-    p.put(Point(.5, .5));
-    p.put(Point(0.1, 0.1));
-//    std::cout << std::endl << "PointSet was filled with points:" << std::endl;
-//    if (!p.empty()) std::cout << "PointSet contains smth" << std::endl;
-//    std::cout << p.size() << std::endl;
-//
-//    if (p.contains(Point(0,0))) std::cout << "PointSet contains (0; 0)" << std::endl;
-//    if (!p.contains(Point(0.5,0))) std::cout << "PointSet does not contain (0.5; 0)" << std::endl;
-//
-////    auto it = p.begin();
-////    std::cout << "First element of PointSet if (0.; 0.): " << std::endl;
-////    if (*it->x() == 0.) std::cout << "abscissa is correct" << std::endl;
-////    if (*it->y() == 0.) std::cout << "ordinate is correct" << std::endl;
-//
-//    std::cout << std::endl;
-//    auto n = p.nearest(Point(.4, .4));
-//    if (n.has_value()) std::cout << "Nearest to point (0.4; 0.4) was found" << std::endl;
-//    if (Point(.4, .4) ==  *n) std::cout << "Nearest point is (0.4; 0.4)" << std::endl;
-//
-//    std::cout << std::endl;
-////    Point po = p.nearest(Point(.4, .4));
-    auto m = p.nearest(Point(.4, .4), 3);
-//    std::cout << *m.first;
-    int cnt = 0;
-    auto it3 = m.first;
-    while (it3 != m.second) {
-        std::cout << *it3 << std::endl;
-        ++it3;
-        cnt++;
-    }
-    std::cout << cnt << std::endl;
-
-    auto m1 = p.nearest(Point(.4, .4), 2);
-//    std::cout << *m.first;
-    int cnt1 = 0;
-    auto it31 = m1.first;
-    while (it31 != m1.second) {
-        std::cout << *it31 << std::endl;
-        ++it31;
-        cnt1++;
-    }
-    std::cout << cnt1 << std::endl;
-
-    std::cout << std::endl;
-    std::cout << std::endl << "Points inside rectangle {(0.3; 0.3); (0.7; 0.7)}:" << std::endl;
-    auto range = p.range(Rect(Point(0.3, 0.3), Point(.7, .7)));
-    auto range1 = p.range(Rect(Point(0.0, 0.0), Point(1.1, 1.1)));
-
-    std::cout << 1 << std::endl;
-    kdtree::PointSet ans1;
-    auto it11 = range1.first;
-    auto it21 = range1.second;
-    while (it11 != it21) {
-        std::cout << *it11 << std::endl;
-        ans1.put(*it11);
-        ++it11;
-    }
-    std::cout << ans1.size() << std::endl;
-
-    auto range2 = p.range(Rect(Point(0.3, 0.3), Point(.7, .7)));
-    kdtree::PointSet ans;
-    auto it1 = range.first;
-    auto it2 = range.second;
-    while (it1 != it2) {
-        std::cout << *it1 << std::endl;
-        ans.put(*it1);
-        ++it1;
-    }
-    std::cout << ans.size() << std::endl;
-
-    kdtree::PointSet ans2;
-    auto it12 = range2.first;
-    auto it22 = range2.second;
-    while (it12 != it22) {
-        std::cout << *it1 << std::endl;
-        ans2.put(*it12);
-        ++it12;
-    }
-    std::cout << ans2.size() << std::endl;
-
-//    std::cout << std::endl << "Points inside rectangle {(0.6; 0.6); (2; 2)}:" << std::endl;
-//    auto range1 = p.range(Rect(Point(0.6, 0.6), Point(2, 2)));
-//    kdtree::PointSet ans1;
-//    auto it11 = range1.first;
-//    auto it21 = range1.second;
-//    while (it11 != it21) {
-//        std::cout << *it11 << std::endl;
-//        ans1.put(*it11);
-//        ++it11;
-//    }
-//    std::cout << ans1.size() << std::endl;
+    std::string points_path, queries_path, format, backend = "kdtree";
+    std::size_t threads = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--verify")
+        {
+            return verify() ? 0 : 1;
+        }
+        if (i + 1 == argc)
+        {
+            std::cerr << usage;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--points") points_path = value;
+        else if (arg == "--queries") queries_path = value;
+        else if (arg == "--format") format = value;
+        else if (arg == "--backend") backend = value;
+        else if (arg == "--threads") threads = std::max(1, std::atoi(value.c_str()));
+        else
+        {
+            std::cerr << usage;
+            return 1;
+        }
+    }
+    if (points_path.empty())
+    {
+        std::cerr << usage;
+        return 1;
+    }
+    if (format.empty())
+    {
+        bool bin = points_path.size() >= 4 && points_path.compare(points_path.size() - 4, 4, ".bin") == 0;
+        format = bin ? "bin" : "csv";
+    }
+    if (threads > 1 && backend != "sharded")
+    {
+        std::cerr << "--threads " << threads << ": only the sharded backend is safe to share between threads" << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Point> points;
+    {
+        MappedFile file(points_path);
+        if (!file.ok())
+        {
+            std::cerr << points_path << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        if (format == "bin")
+        {
+            points = load_binary(file);
+        }
+        else if (!load_csv(file, points))
+        {
+            return 1;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "loaded " << points.size() << " points from " << points_path << " in " << seconds << " s" << std::endl;
+
+    std::vector<Query> queries;
+    if (!queries_path.empty())
+    {
+        MappedFile file(queries_path);
+        if (!file.ok())
+        {
+            std::cerr << queries_path << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        if (!load_queries(file, queries))
+        {
+            return 1;
+        }
+    }
+
+    if (backend == "kdtree") load_and_run<kdtree::PointSet>(points, queries, threads);
+    else if (backend == "rbtree") load_and_run<rbtree::PointSet>(points, queries, threads);
+    else if (backend == "grid") load_and_run<grid::PointSet>(points, queries, threads);
+    else if (backend == "adaptive") load_and_run<adaptive::PointSet>(points, queries, threads);
+    else if (backend == "sharded") load_and_run<sharded::PointSet>(points, queries, threads);
+    else
+    {
+        std::cerr << usage;
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,358 @@
+#include "primitives.h"
+#include <iostream>
+
+namespace
+{
+    double coord(const Point &p, bool split)
+    {
+        return split ? p.x() : p.y();
+    }
+
+    // Partitions [first, last) around the median of the axis with the larger spread, so that
+    // points[first, mid) have coord < value. Returns false if the points cannot be separated.
+    bool median_split(std::vector<Point> &points, std::size_t first, std::size_t last,
+                      bool &split, double &value, std::size_t &mid)
+    {
+        auto begin = points.begin() + first;
+        auto end = points.begin() + last;
+        auto xs = std::minmax_element(begin, end, [](const Point &a, const Point &b) { return a.x() < b.x(); });
+        auto ys = std::minmax_element(begin, end, [](const Point &a, const Point &b) { return a.y() < b.y(); });
+        bool wide_x = xs.second->x() - xs.first->x() >= ys.second->y() - ys.first->y();
+
+        for (bool axis : {wide_x, !wide_x})
+        {
+            auto less = [axis](const Point &a, const Point &b) { return coord(a, axis) < coord(b, axis); };
+            std::nth_element(begin, begin + (last - first) / 2, end, less);
+            double median = coord(*(begin + (last - first) / 2), axis);
+            auto it = std::partition(begin, end, [axis, median](const Point &p) { return coord(p, axis) < median; });
+            if (it == begin)
+            {
+                // the median is the minimum, so cut just above it instead
+                auto above = std::partition(begin, end, [axis, median](const Point &p) { return coord(p, axis) == median; });
+                if (above == end)
+                {
+                    continue;
+                }
+                median = coord(*std::min_element(above, end, less), axis);
+                it = above;
+            }
+            split = axis;
+            value = median;
+            mid = it - points.begin();
+            return true;
+        }
+        return false;
+    }
+}
+
+namespace sharded
+{
+
+    bool Shard::intersects(const Rect &rect) const
+    {
+        return rect.xmin() < m_xmax && rect.xmax() > m_xmin && rect.ymin() < m_ymax && rect.ymax() > m_ymin;
+    }
+
+    double Shard::distance(const Point &p) const
+    {
+        double dx = std::max({m_xmin - p.x(), 0.0, p.x() - m_xmax});
+        double dy = std::max({m_ymin - p.y(), 0.0, p.y() - m_ymax});
+        return sqrt(dx * dx + dy * dy);
+    }
+
+    PointSetIterator::PointSetIterator(const std::vector<std::unique_ptr<Shard>> *shards, std::size_t shard,
+                                       kdtree::PointSet::ForwardIt it)
+            : m_shards(shards), m_shard(shard), m_it(std::move(it))
+    {
+        skip_empty();
+    }
+
+    const Point &PointSetIterator::operator*() const
+    {
+        return std::visit([](auto &it) -> const Point & { return *it; }, m_it);
+    }
+
+    PointSetIterator &PointSetIterator::operator++()
+    {
+        std::visit([](auto &it) { ++it; }, m_it);
+        skip_empty();
+        return *this;
+    }
+
+    void PointSetIterator::skip_empty()
+    {
+        if (m_shards == nullptr)
+        {
+            return;
+        }
+        auto &it = std::get<kdtree::PointSet::ForwardIt>(m_it);
+        while (it == (*m_shards)[m_shard]->m_points.end() && m_shard + 1 < m_shards->size())
+        {
+            m_shard++;
+            it = (*m_shards)[m_shard]->m_points.begin();
+        }
+    }
+
+    PointSet::PointSet(std::size_t max_shard_size) : m_max_shard_size(max_shard_size)
+    {
+        m_directory.emplace_back();
+        m_shards.push_back(std::make_unique<Shard>());
+    }
+
+    void PointSet::load(std::vector<Point> points)
+    {
+        std::sort(points.begin(), points.end());
+        points.erase(std::unique(points.begin(), points.end()), points.end());
+        m_size = points.size();
+        m_directory.emplace_back();
+        load(0, std::make_unique<Shard>(), points, 0, points.size());
+    }
+
+    // Splits at quantiles until every shard is at most half full, leaving room for online growth.
+    void PointSet::load(std::size_t split, std::unique_ptr<Shard> shard, std::vector<Point> &points,
+                        std::size_t first, std::size_t last)
+    {
+        bool axis;
+        double value;
+        std::size_t mid;
+        if (last - first > std::max<std::size_t>(1, m_max_shard_size / 2) &&
+            median_split(points, first, last, axis, value, mid))
+        {
+            auto left = std::make_unique<Shard>();
+            auto right = std::make_unique<Shard>();
+            left->m_xmin = right->m_xmin = shard->m_xmin;
+            left->m_ymin = right->m_ymin = shard->m_ymin;
+            left->m_xmax = right->m_xmax = shard->m_xmax;
+            left->m_ymax = right->m_ymax = shard->m_ymax;
+            (axis ? left->m_xmax : left->m_ymax) = value;
+            (axis ? right->m_xmin : right->m_ymin) = value;
+
+            Split &node = m_directory[split];
+            node.m_leaf = false;
+            node.m_split = axis;
+            node.m_value = value;
+            std::size_t left_split = node.m_left = m_directory.size();
+            std::size_t right_split = node.m_right = m_directory.size() + 1;
+            m_directory.emplace_back();
+            m_directory.emplace_back();
+            load(left_split, std::move(left), points, first, mid);
+            load(right_split, std::move(right), points, mid, last);
+            return;
+        }
+        auto leaf = std::make_unique<Shard>(points.begin() + first, points.begin() + last);
+        leaf->m_xmin = shard->m_xmin;
+        leaf->m_ymin = shard->m_ymin;
+        leaf->m_xmax = shard->m_xmax;
+        leaf->m_ymax = shard->m_ymax;
+        m_directory[split].m_shard = m_shards.size();
+        m_shards.push_back(std::move(leaf));
+    }
+
+    std::size_t PointSet::shards() const
+    {
+        std::shared_lock<std::shared_mutex> lock(m_directory_mutex);
+        return m_shards.size();
+    }
+
+    bool PointSet::empty() const
+    {
+        return m_size == 0;
+    }
+
+    std::size_t PointSet::size() const
+    {
+        return m_size;
+    }
+
+    std::size_t PointSet::find(const Point &p) const
+    {
+        std::size_t split = 0;
+        while (!m_directory[split].m_leaf)
+        {
+            const Split &node = m_directory[split];
+            split = coord(p, node.m_split) < node.m_value ? node.m_left : node.m_right;
+        }
+        return m_directory[split].m_shard;
+    }
+
+    void PointSet::put(const Point &p)
+    {
+        std::size_t index;
+        bool full;
+        {
+            std::shared_lock<std::shared_mutex> directory_lock(m_directory_mutex);
+            index = find(p);
+            Shard &shard = *m_shards[index];
+            std::lock_guard<std::mutex> lock(shard.m_mutex);
+            std::size_t size = shard.m_points.size();
+            shard.m_points.put(p);
+            if (shard.m_points.size() == size)
+            {
+                return;
+            }
+            m_size++;
+            full = shard.m_points.size() > m_max_shard_size;
+        }
+        if (full)
+        {
+            resplit(index);
+        }
+    }
+
+    // Replaces an overfull shard by two shards split at its median. Writers to every shard wait
+    // for the exclusive directory lock, so this is amortized over max_shard_size / 2 insertions.
+    void PointSet::resplit(std::size_t index)
+    {
+        std::unique_lock<std::shared_mutex> directory_lock(m_directory_mutex);
+        Shard &shard = *m_shards[index];
+        if (shard.m_points.size() <= m_max_shard_size)
+        {
+            return; // another writer got here first
+        }
+
+        std::vector<Point> points(shard.m_points.begin(), shard.m_points.end());
+        bool split;
+        double value;
+        std::size_t mid;
+        if (!median_split(points, 0, points.size(), split, value, mid))
+        {
+            return;
+        }
+
+        auto left = std::make_unique<Shard>(points.begin(), points.begin() + mid);
+        auto right = std::make_unique<Shard>(points.begin() + mid, points.end());
+        left->m_xmin = right->m_xmin = shard.m_xmin;
+        left->m_ymin = right->m_ymin = shard.m_ymin;
+        left->m_xmax = right->m_xmax = shard.m_xmax;
+        left->m_ymax = right->m_ymax = shard.m_ymax;
+        (split ? left->m_xmax : left->m_ymax) = value;
+        (split ? right->m_xmin : right->m_ymin) = value;
+
+        auto node = std::find_if(m_directory.begin(), m_directory.end(),
+                                 [index](const Split &s) { return s.m_leaf && s.m_shard == index; });
+        node->m_leaf = false;
+        node->m_split = split;
+        node->m_value = value;
+        node->m_left = m_directory.size();
+        node->m_right = m_directory.size() + 1;
+
+        Split leaf;
+        leaf.m_shard = index;
+        m_directory.push_back(leaf);
+        leaf.m_shard = m_shards.size();
+        m_directory.push_back(leaf);
+        m_shards[index] = std::move(left);
+        m_shards.push_back(std::move(right));
+    }
+
+    bool PointSet::contains(const Point &p) const
+    {
+        std::shared_lock<std::shared_mutex> directory_lock(m_directory_mutex);
+        const Shard &shard = *m_shards[find(p)];
+        std::lock_guard<std::mutex> lock(shard.m_mutex);
+        return shard.m_points.contains(p);
+    }
+
+    PointSet::Answers &PointSet::answers() const
+    {
+        auto id = std::this_thread::get_id();
+        {
+            std::shared_lock<std::shared_mutex> lock(m_answers_mutex);
+            auto it = m_answers.find(id);
+            if (it != m_answers.end())
+            {
+                return it->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(m_answers_mutex);
+        return m_answers[id];
+    }
+
+    std::pair<PointSet::ForwardIt, PointSet::ForwardIt> PointSet::range(const Rect &rect) const
+    {
+        std::vector<Point> &ans_range = answers().m_range;
+        ans_range.clear();
+        std::shared_lock<std::shared_mutex> directory_lock(m_directory_mutex);
+        for (const auto &shard : m_shards)
+        {
+            if (!shard->intersects(rect))
+            {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(shard->m_mutex);
+            shard->m_points.visit_range(rect, [&ans_range](const Point &p) { ans_range.push_back(p); });
+        }
+        return {PointSetIterator(ans_range.cbegin()), PointSetIterator(ans_range.cend())};
+    }
+
+    PointSet::ForwardIt PointSet::begin() const
+    {
+        return PointSetIterator(&m_shards, 0, m_shards.front()->m_points.begin());
+    }
+
+    PointSet::ForwardIt PointSet::end() const
+    {
+        return PointSetIterator(&m_shards, m_shards.size() - 1, m_shards.back()->m_points.end());
+    }
+
+    // Visits shards in order of their distance to p and stops at the first one that lies beyond
+    // the k-th best candidate found so far.
+    void PointSet::nearest(const Point &p, std::size_t k, std::priority_queue<std::pair<double, Point>> &heap) const
+    {
+        std::shared_lock<std::shared_mutex> directory_lock(m_directory_mutex);
+        std::vector<std::pair<double, const Shard *>> order;
+        for (const auto &shard : m_shards)
+        {
+            order.emplace_back(shard->distance(p), shard.get());
+        }
+        std::sort(order.begin(), order.end());
+
+        for (const auto &[distance, shard] : order)
+        {
+            if (heap.size() == k && distance >= heap.top().first)
+            {
+                break;
+            }
+            std::lock_guard<std::mutex> lock(shard->m_mutex);
+            shard->m_points.nearest(p, k, heap);
+        }
+    }
+
+    std::optional<Point> PointSet::nearest(const Point &p) const
+    {
+        std::priority_queue<std::pair<double, Point>> heap;
+        nearest(p, 1, heap);
+        if (heap.empty())
+        {
+            return {};
+        }
+        return heap.top().second;
+    }
+
+    std::pair<PointSet::ForwardIt, PointSet::ForwardIt> PointSet::nearest(const Point &p, std::size_t k) const
+    {
+        std::priority_queue<std::pair<double, Point>> heap;
+        if (k != 0)
+        {
+            nearest(p, k, heap);
+        }
+
+        std::vector<Point> &ans_nearest = answers().m_nearest;
+        ans_nearest.clear();
+        for (; !heap.empty(); heap.pop())
+        {
+            ans_nearest.push_back(heap.top().second);
+        }
+        std::reverse(ans_nearest.begin(), ans_nearest.end());
+        return {PointSetIterator(ans_nearest.cbegin()), PointSetIterator(ans_nearest.cend())};
+    }
+
+    std::ostream &operator<<(std::ostream &os, const PointSet &p)
+    {
+        for (const auto &point : p)
+        {
+            os << point << std::endl;
+        }
+        return os;
+    }
+}